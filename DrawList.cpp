@@ -0,0 +1,157 @@
+#include "DrawList.h"
+
+#include <map>
+
+using namespace std;
+using namespace chag;
+
+//*****************************************************************************
+//	Uniform location cache
+//*****************************************************************************
+struct UniformLocations
+{
+	GLint modelMatrix;
+	GLint viewMatrix;
+	GLint inverseViewNormalMatrix;
+	GLint projectionMatrix;
+	GLint lightMatrix;
+	GLint lightpos;
+	GLint viewSpaceLightDir;
+	GLint objectReflectiveness;
+	GLint objectAlpha;
+	GLint shadowMap;
+	GLint environmentMap;
+};
+
+static map<GLuint, UniformLocations> uniformLocationCache;
+
+static const UniformLocations &getUniformLocations(GLuint program)
+{
+	map<GLuint, UniformLocations>::iterator it = uniformLocationCache.find(program);
+	if( it != uniformLocationCache.end() )
+	{
+		return it->second;
+	}
+
+	// Uniforms that a program doesn't use get location -1, which GL
+	// silently ignores.
+	UniformLocations l;
+	l.modelMatrix = glGetUniformLocation(program, "modelMatrix");
+	l.viewMatrix = glGetUniformLocation(program, "viewMatrix");
+	l.inverseViewNormalMatrix = glGetUniformLocation(program, "inverseViewNormalMatrix");
+	l.projectionMatrix = glGetUniformLocation(program, "projectionMatrix");
+	l.lightMatrix = glGetUniformLocation(program, "lightMatrix");
+	l.lightpos = glGetUniformLocation(program, "lightpos");
+	l.viewSpaceLightDir = glGetUniformLocation(program, "viewSpaceLightDir");
+	l.objectReflectiveness = glGetUniformLocation(program, "object_reflectiveness");
+	l.objectAlpha = glGetUniformLocation(program, "object_alpha");
+	l.shadowMap = glGetUniformLocation(program, "shadowMap");
+	l.environmentMap = glGetUniformLocation(program, "environmentMap");
+	return uniformLocationCache[program] = l;
+}
+
+void clearUniformLocationCache()
+{
+	uniformLocationCache.clear();
+}
+
+static void setMatrix(GLint location, const float4x4 &m)
+{
+	glUniformMatrix4fv(location, 1, GL_FALSE, reinterpret_cast<const float *>(&m));
+}
+
+//*****************************************************************************
+//	Execution
+//*****************************************************************************
+void executeDrawList(const DrawList &list)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, list.framebuffer);
+	if( list.cubeMapFace != 0 )
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			list.cubeMapFace, list.colorCubeMap, 0);
+	}
+	glViewport(0, 0, list.viewportWidth, list.viewportHeight);
+
+	glClearColor(list.clearColor.x, list.clearColor.y, list.clearColor.z,
+		list.clearColor.w);
+	glClearDepth(1.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// The program failed to build (and no reload has fixed it yet). Leave
+	// the target cleared rather than drawing with no program bound.
+	if( list.program == 0 )
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return;
+	}
+
+	glEnable(GL_DEPTH_TEST);	// enable Z-buffering
+	glEnable(GL_CULL_FACE);		// enable back face culling.
+	if( list.polygonOffset )
+	{
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(1.0, 2);
+	}
+
+	glUseProgram(list.program);
+	const UniformLocations &l = getUniformLocations(list.program);
+
+	const PassUniforms &u = list.uniforms;
+	setMatrix(l.viewMatrix, u.viewMatrix);
+	setMatrix(l.inverseViewNormalMatrix, u.inverseViewNormalMatrix);
+	setMatrix(l.projectionMatrix, u.projectionMatrix);
+	setMatrix(l.lightMatrix, u.lightMatrix);
+	glUniform3fv(l.lightpos, 1, &u.lightpos.x);
+	glUniform3fv(l.viewSpaceLightDir, 1, &u.viewSpaceLightDir.x);
+
+	if( list.shadowMap != 0 )
+	{
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, list.shadowMap);
+		glUniform1i(l.shadowMap, 1);
+	}
+	if( list.environmentMap != 0 )
+	{
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, list.environmentMap);
+		glUniform1i(l.environmentMap, 2);
+	}
+
+	bool blending = false;
+	for( size_t i = 0; i < list.commands.size(); i++ )
+	{
+		const DrawCommand &c = list.commands[i];
+		if( c.blend != blending )
+		{
+			blending = c.blend;
+			if( blending )
+			{
+				glDepthMask(GL_FALSE);
+				glEnable(GL_BLEND);
+				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			}
+			else
+			{
+				glDisable(GL_BLEND);
+				glDepthMask(GL_TRUE);
+			}
+		}
+		setMatrix(l.modelMatrix, c.modelMatrix);
+		glUniform1f(l.objectReflectiveness, c.reflectiveness);
+		glUniform1f(l.objectAlpha, c.alpha);
+		c.model->render();
+	}
+
+	if( blending )
+	{
+		glDisable(GL_BLEND);
+		glDepthMask(GL_TRUE);
+	}
+	if( list.polygonOffset )
+	{
+		glDisable(GL_POLYGON_OFFSET_FILL);
+	}
+	glUseProgram(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,67 @@
+#ifndef DRAW_LIST_H
+#define DRAW_LIST_H
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include <OBJModel.h>
+#include <float4x4.h>
+
+/* A draw list holds everything needed to render one pass (the shadow map,
+ * a cube map face or the main view) as plain data: render target, state,
+ * fully resolved per-pass uniforms, and one command per object. Draw lists
+ * are built without touching GL, so they can be prepared on worker threads,
+ * and are then executed on the GL thread with executeDrawList().
+ */
+
+// Uniforms that are the same for all objects in a pass.
+struct PassUniforms
+{
+	chag::float4x4 viewMatrix;
+	chag::float4x4 inverseViewNormalMatrix;
+	chag::float4x4 projectionMatrix;
+	chag::float4x4 lightMatrix;
+	chag::float3 lightpos;
+	chag::float3 viewSpaceLightDir;
+};
+
+struct DrawCommand
+{
+	OBJModel *model;
+	chag::float4x4 modelMatrix;
+	float reflectiveness;
+	float alpha;
+	// Alpha blended, without depth writes. Must come after all opaque
+	// commands in the list.
+	bool blend;
+};
+
+struct DrawList
+{
+	GLuint program;
+	GLuint framebuffer;
+	// Face of colorCubeMap to attach as color target, or 0 to leave the
+	// attachments of the framebuffer as they are.
+	GLenum cubeMapFace;
+	GLuint colorCubeMap;
+	int viewportWidth;
+	int viewportHeight;
+	chag::float4 clearColor;
+	bool polygonOffset;
+
+	// Textures to bind, 0 for none.
+	GLuint shadowMap;			// on unit 1
+	GLuint environmentMap;		// on unit 2
+
+	PassUniforms uniforms;
+	std::vector<DrawCommand> commands;
+};
+
+void executeDrawList(const DrawList &list);
+
+// Uniform locations are cached per program; call this when programs have
+// been rebuilt, since the driver may reuse the names of deleted programs.
+void clearUniformLocationCache();
+
+#endif // DRAW_LIST_H
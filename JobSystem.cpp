@@ -0,0 +1,262 @@
+#include "JobSystem.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+//*****************************************************************************
+//	Thin wrappers around the native threading primitives
+//*****************************************************************************
+#ifdef _WIN32
+struct JobSystem::Platform
+{
+	vector<HANDLE> threads;
+	CRITICAL_SECTION mutex;
+	CONDITION_VARIABLE workAvailable;
+	CONDITION_VARIABLE workDone;
+};
+
+#define LOCK(p)				EnterCriticalSection(&(p)->mutex)
+#define UNLOCK(p)			LeaveCriticalSection(&(p)->mutex)
+#define WAIT(p, cond)		SleepConditionVariableCS(&(p)->cond, &(p)->mutex, INFINITE)
+#define SIGNAL(p, cond)		WakeConditionVariable(&(p)->cond)
+#define BROADCAST(p, cond)	WakeAllConditionVariable(&(p)->cond)
+#else
+struct JobSystem::Platform
+{
+	vector<pthread_t> threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t workAvailable;
+	pthread_cond_t workDone;
+};
+
+#define LOCK(p)				pthread_mutex_lock(&(p)->mutex)
+#define UNLOCK(p)			pthread_mutex_unlock(&(p)->mutex)
+#define WAIT(p, cond)		pthread_cond_wait(&(p)->cond, &(p)->mutex)
+#define SIGNAL(p, cond)		pthread_cond_signal(&(p)->cond)
+#define BROADCAST(p, cond)	pthread_cond_broadcast(&(p)->cond)
+#endif
+
+int JobSystem::numCores()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return int(info.dwNumberOfProcessors);
+#else
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? int(cores) : 1;
+#endif
+}
+
+#ifdef _WIN32
+unsigned long __stdcall JobSystem::workerEntry(void *jobSystem)
+{
+	((JobSystem *)jobSystem)->workerLoop();
+	return 0;
+}
+#else
+void *JobSystem::workerEntry(void *jobSystem)
+{
+	((JobSystem *)jobSystem)->workerLoop();
+	return 0;
+}
+#endif
+
+//*****************************************************************************
+//	JobSystem
+//*****************************************************************************
+JobSystem::JobSystem(int numWorkers)
+	: m_platform(new Platform)
+	, m_numWorkers(0)
+	, m_job(0)
+	, m_userData(0)
+	, m_count(0)
+	, m_next(0)
+	, m_remaining(0)
+	, m_quit(false)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(&m_platform->mutex);
+	InitializeConditionVariable(&m_platform->workAvailable);
+	InitializeConditionVariable(&m_platform->workDone);
+#else
+	pthread_mutex_init(&m_platform->mutex, 0);
+	pthread_cond_init(&m_platform->workAvailable, 0);
+	pthread_cond_init(&m_platform->workDone, 0);
+#endif
+
+	if( numWorkers < 0 )
+	{
+		numWorkers = numCores() - 1;
+	}
+	for( int i = 0; i < numWorkers; i++ )
+	{
+#ifdef _WIN32
+		HANDLE thread = CreateThread(0, 0, &JobSystem::workerEntry, this, 0, 0);
+		if( thread == 0 ) break;
+		m_platform->threads.push_back(thread);
+#else
+		pthread_t thread;
+		if( pthread_create(&thread, 0, &JobSystem::workerEntry, this) != 0 ) break;
+		m_platform->threads.push_back(thread);
+#endif
+	}
+	m_numWorkers = int(m_platform->threads.size());
+}
+
+JobSystem::~JobSystem()
+{
+	LOCK(m_platform);
+	m_quit = true;
+	BROADCAST(m_platform, workAvailable);
+	UNLOCK(m_platform);
+
+	for( size_t i = 0; i < m_platform->threads.size(); i++ )
+	{
+#ifdef _WIN32
+		WaitForSingleObject(m_platform->threads[i], INFINITE);
+		CloseHandle(m_platform->threads[i]);
+#else
+		pthread_join(m_platform->threads[i], 0);
+#endif
+	}
+
+#ifdef _WIN32
+	DeleteCriticalSection(&m_platform->mutex);
+#else
+	pthread_cond_destroy(&m_platform->workDone);
+	pthread_cond_destroy(&m_platform->workAvailable);
+	pthread_mutex_destroy(&m_platform->mutex);
+#endif
+	delete m_platform;
+}
+
+void JobSystem::parallelFor(int count, JobFunc job, void *userData)
+{
+	if( count <= 0 )
+	{
+		return;
+	}
+	if( count == 1 || m_numWorkers == 0 )
+	{
+		for( int i = 0; i < count; i++ )
+		{
+			job(i, userData);
+		}
+		return;
+	}
+
+	LOCK(m_platform);
+	m_job = job;
+	m_userData = userData;
+	m_count = count;
+	m_next = 0;
+	m_remaining = count;
+
+	// The calling thread takes jobs too, so wake one worker for each of the
+	// remaining jobs at most. Waking every worker for a handful of jobs
+	// would just have them fight over the mutex.
+	int wake = count - 1 < m_numWorkers ? count - 1 : m_numWorkers;
+	for( int i = 0; i < wake; i++ )
+	{
+		SIGNAL(m_platform, workAvailable);
+	}
+	UNLOCK(m_platform);
+
+	runJobs();
+
+	LOCK(m_platform);
+	while( m_remaining != 0 )
+	{
+		WAIT(m_platform, workDone);
+	}
+	m_job = 0;
+	UNLOCK(m_platform);
+}
+
+void JobSystem::startBackgroundJob(BackgroundJob &job)
+{
+	job.finished = false;
+	if( m_numWorkers == 0 )
+	{
+		job.job(0, job.userData);
+		job.finished = true;
+		return;
+	}
+	LOCK(m_platform);
+	m_backgroundJobs.push_back(&job);
+	SIGNAL(m_platform, workAvailable);
+	UNLOCK(m_platform);
+}
+
+bool JobSystem::isFinished(const BackgroundJob &job)
+{
+	LOCK(m_platform);
+	bool finished = job.finished;
+	UNLOCK(m_platform);
+	return finished;
+}
+
+void JobSystem::workerLoop()
+{
+	for( ;; )
+	{
+		LOCK(m_platform);
+		while( !m_quit && !(m_job != 0 && m_next < m_count)
+			&& m_backgroundJobs.empty() )
+		{
+			WAIT(m_platform, workAvailable);
+		}
+		if( m_quit )
+		{
+			UNLOCK(m_platform);
+			return;
+		}
+		// parallelFor() batches come first, since the caller is waiting.
+		if( m_job != 0 && m_next < m_count )
+		{
+			UNLOCK(m_platform);
+			runJobs();
+			continue;
+		}
+		BackgroundJob *job = m_backgroundJobs.front();
+		m_backgroundJobs.pop_front();
+		UNLOCK(m_platform);
+
+		job->job(0, job->userData);
+
+		LOCK(m_platform);
+		job->finished = true;
+		UNLOCK(m_platform);
+	}
+}
+
+// Takes jobs from the current batch until there are none left. Jobs are
+// handed out one at a time, since they tend to be few and large (one per
+// render pass).
+void JobSystem::runJobs()
+{
+	LOCK(m_platform);
+	while( m_job != 0 && m_next < m_count )
+	{
+		int index = m_next++;
+		JobFunc job = m_job;
+		void *userData = m_userData;
+		UNLOCK(m_platform);
+
+		job(index, userData);
+
+		LOCK(m_platform);
+		if( --m_remaining == 0 )
+		{
+			SIGNAL(m_platform, workDone);
+		}
+	}
+	UNLOCK(m_platform);
+}
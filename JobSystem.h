@@ -0,0 +1,71 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <vector>
+#include <deque>
+
+/* A small pool of worker threads for CPU side work, such as building draw
+ * lists. The jobs must not make any GL calls; the GL context is only
+ * current on the GLUT thread.
+ *
+ * Uses the native thread API (Win32 or pthreads) rather than <thread>, so
+ * it builds with the VS2008 and VS2010 projects too.
+ */
+class JobSystem
+{
+public:
+	typedef void (*JobFunc)(int index, void *userData);
+
+	// A single job that runs on a worker while the caller carries on.
+	struct BackgroundJob
+	{
+		JobFunc job;		// Called with index 0
+		void *userData;
+		bool finished;		// Read with isFinished()
+	};
+
+	// By default, one worker per core besides the calling thread.
+	explicit JobSystem(int numWorkers = -1);
+	~JobSystem();
+
+	// Runs job(0, userData) ... job(count - 1, userData), spread over the
+	// workers and the calling thread, and returns when all of them have
+	// finished. Only as many workers as there are jobs are woken up.
+	void parallelFor(int count, JobFunc job, void *userData);
+
+	// Queues a background job. Without workers, it runs right away. The job
+	// and its data must stay alive until isFinished() returns true (or the
+	// job system is destroyed).
+	void startBackgroundJob(BackgroundJob &job);
+	bool isFinished(const BackgroundJob &job);
+
+	int getNumThreads() const { return m_numWorkers + 1; }
+
+private:
+	struct Platform;
+
+	static int numCores();
+#ifdef _WIN32
+	static unsigned long __stdcall workerEntry(void *jobSystem);
+#else
+	static void *workerEntry(void *jobSystem);
+#endif
+	void workerLoop();
+	void runJobs();
+
+	Platform *m_platform;
+	int m_numWorkers;
+
+	// The current batch, protected by the mutex in m_platform.
+	JobFunc m_job;
+	void *m_userData;
+	int m_count;
+	int m_next;
+	int m_remaining;
+	bool m_quit;
+
+	// Queued background jobs, also protected by the mutex.
+	std::deque<BackgroundJob *> m_backgroundJobs;
+};
+
+#endif // JOB_SYSTEM_H
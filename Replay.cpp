@@ -0,0 +1,214 @@
+#include "Replay.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+static const char replayMagic[4] = { 'R', 'P', 'L', 'Y' };
+static const unsigned int replayVersion = 1;
+
+// Flush the capture regularly, so that a crash loses at most a second or so.
+static const int replayFlushInterval = 60;
+
+//*****************************************************************************
+//	ReplayWriter
+//*****************************************************************************
+ReplayWriter::ReplayWriter()
+	: m_file(0)
+	, m_frameCount(0)
+{
+}
+
+ReplayWriter::~ReplayWriter()
+{
+	close();
+}
+
+bool ReplayWriter::open(const char *fileName)
+{
+	close();
+	m_file = fopen(fileName, "wb");
+	if( !m_file )
+	{
+		printf("Failed to open %s for writing\n", fileName);
+		return false;
+	}
+	fwrite(replayMagic, 1, sizeof(replayMagic), m_file);
+	fwrite(&replayVersion, sizeof(replayVersion), 1, m_file);
+	m_frameCount = 0;
+	return true;
+}
+
+void ReplayWriter::close()
+{
+	if( m_file )
+	{
+		fclose(m_file);
+		m_file = 0;
+	}
+}
+
+void ReplayWriter::writeFrame(const ReplayFrame &frame)
+{
+	if( !m_file || frame.width <= 0 || frame.height <= 0 )
+	{
+		return;
+	}
+	float values[5] = { frame.cameraTheta, frame.cameraPhi, frame.cameraR,
+		frame.cameraTargetAltitude, frame.currentTime };
+	unsigned short size[2] = { (unsigned short)frame.width,
+		(unsigned short)frame.height };
+	unsigned char flags = frame.paused ? 1 : 0;
+
+	fwrite(values, sizeof(values), 1, m_file);
+	fwrite(size, sizeof(size), 1, m_file);
+	fwrite(&flags, sizeof(flags), 1, m_file);
+
+	if( ++m_frameCount % replayFlushInterval == 0 )
+	{
+		fflush(m_file);
+	}
+}
+
+//*****************************************************************************
+//	ReplayReader
+//*****************************************************************************
+ReplayReader::ReplayReader()
+	: m_file(0)
+{
+}
+
+ReplayReader::~ReplayReader()
+{
+	close();
+}
+
+bool ReplayReader::open(const char *fileName)
+{
+	close();
+	m_file = fopen(fileName, "rb");
+	if( !m_file )
+	{
+		printf("Failed to open %s for reading\n", fileName);
+		return false;
+	}
+	char magic[4];
+	unsigned int version = 0;
+	if( fread(magic, 1, sizeof(magic), m_file) != sizeof(magic)
+		|| memcmp(magic, replayMagic, sizeof(magic)) != 0
+		|| fread(&version, sizeof(version), 1, m_file) != 1
+		|| version != replayVersion )
+	{
+		printf("%s is not a replay capture (or has an unsupported version)\n",
+			fileName);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void ReplayReader::close()
+{
+	if( m_file )
+	{
+		fclose(m_file);
+		m_file = 0;
+	}
+}
+
+bool ReplayReader::readFrame(ReplayFrame &frame)
+{
+	if( !m_file )
+	{
+		return false;
+	}
+	float values[5];
+	unsigned short size[2];
+	unsigned char flags;
+	if( fread(values, sizeof(values), 1, m_file) != 1
+		|| fread(size, sizeof(size), 1, m_file) != 1
+		|| fread(&flags, sizeof(flags), 1, m_file) != 1 )
+	{
+		return false;
+	}
+	frame.cameraTheta = values[0];
+	frame.cameraPhi = values[1];
+	frame.cameraR = values[2];
+	frame.cameraTargetAltitude = values[3];
+	frame.currentTime = values[4];
+	// Older captures may contain frames from a minimized window.
+	frame.width = max<int>(size[0], 1);
+	frame.height = max<int>(size[1], 1);
+	frame.paused = (flags & 1) != 0;
+	return true;
+}
+
+void ReplayReader::rewind()
+{
+	if( m_file )
+	{
+		fseek(m_file, long(sizeof(replayMagic) + sizeof(replayVersion)), SEEK_SET);
+	}
+}
+
+//*****************************************************************************
+//	Timing
+//*****************************************************************************
+double replayTimerMilliseconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return double(counter.QuadPart) * 1000.0 / double(frequency.QuadPart);
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return double(now.tv_sec) * 1000.0 + double(now.tv_nsec) / 1000000.0;
+#endif
+}
+
+//*****************************************************************************
+//	Statistics
+//*****************************************************************************
+
+// Nearest-rank percentile of sorted values: the smallest value that at
+// least p percent of the values are less than or equal to.
+static double percentile(const vector<double> &sorted, double p)
+{
+	size_t rank = size_t(ceil(p * double(sorted.size()) / 100.0));
+	rank = min(max(rank, size_t(1)), sorted.size());
+	return sorted[rank - 1];
+}
+
+void printFrameTimeStatistics(vector<double> frameTimes)
+{
+	if( frameTimes.empty() )
+	{
+		printf("No frames rendered.\n");
+		return;
+	}
+	sort(frameTimes.begin(), frameTimes.end());
+
+	double sum = 0.0;
+	for( size_t i = 0; i < frameTimes.size(); i++ )
+	{
+		sum += frameTimes[i];
+	}
+
+	printf("Frames: %d\n", int(frameTimes.size()));
+	printf("Frame time (ms): mean %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n",
+		sum / double(frameTimes.size()),
+		percentile(frameTimes, 50.0),
+		percentile(frameTimes, 95.0),
+		percentile(frameTimes, 99.0),
+		frameTimes.back());
+}
@@ -0,0 +1,80 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include <vector>
+
+/* Capture and playback of the per-frame inputs that decide what gets
+ * rendered, so that a run can be re-rendered exactly, e.g., to benchmark.
+ *
+ * File format (little endian, as written by the machine recording it):
+ *
+ *   header:  char[4] "RPLY", uint32 version
+ *   frame:   float camera_theta, camera_phi, camera_r,
+ *            camera_target_altitude, currentTime
+ *            uint16 width, height (of the main view)
+ *            uint8 flags (bit 0: paused)
+ *
+ * Frames follow the header back to back until the end of the file, so a
+ * capture that was cut short (crash, killed process) can still be played.
+ */
+struct ReplayFrame
+{
+	float cameraTheta;
+	float cameraPhi;
+	float cameraR;
+	float cameraTargetAltitude;
+	float currentTime;
+	int width;
+	int height;
+	bool paused;
+};
+
+class ReplayWriter
+{
+public:
+	ReplayWriter();
+	~ReplayWriter();
+
+	bool open(const char *fileName);
+	void close();
+	bool isOpen() const { return m_file != 0; }
+
+	// Frames with an empty view (a minimized window) are not written, as
+	// there is nothing to replay for them.
+	void writeFrame(const ReplayFrame &frame);
+
+private:
+	FILE *m_file;
+	int m_frameCount;
+};
+
+class ReplayReader
+{
+public:
+	ReplayReader();
+	~ReplayReader();
+
+	bool open(const char *fileName);
+	void close();
+	bool isOpen() const { return m_file != 0; }
+
+	// Returns false at the end of the capture. Sizes are at least 1 x 1.
+	bool readFrame(ReplayFrame &frame);
+
+	// Goes back to the first frame.
+	void rewind();
+
+private:
+	FILE *m_file;
+};
+
+// Current time in milliseconds, from a high resolution clock
+// (QueryPerformanceCounter on Windows, CLOCK_MONOTONIC elsewhere).
+double replayTimerMilliseconds();
+
+// Prints the number of frames, mean and p50/p95/p99/max of the frame times
+// (in milliseconds).
+void printFrameTimeStatistics(std::vector<double> frameTimes);
+
+#endif // REPLAY_H
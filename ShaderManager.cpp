@@ -0,0 +1,457 @@
+#include "ShaderManager.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+//*****************************************************************************
+//	Helper functions
+//*****************************************************************************
+
+// Bump this whenever something that isn't part of the hashed sources (such
+// as the attribute bindings) changes, to invalidate old cached binaries.
+static const char *shaderCacheVersion = "1";
+
+static bool readFile(const string &fileName, string &contents)
+{
+	FILE *file = fopen(fileName.c_str(), "rb");
+	if( !file )
+	{
+		return false;
+	}
+	contents.clear();
+	char buffer[4096];
+	size_t count;
+	while( (count = fread(buffer, 1, sizeof(buffer), file)) > 0 )
+	{
+		contents.append(buffer, count);
+	}
+	fclose(file);
+	return true;
+}
+
+static const unsigned long long hashSeed = 14695981039346656037ULL;
+
+// 64 bit FNV-1a hash, chained through 'hash' so several strings can be
+// combined into one key.
+static unsigned long long hashString(const string &s, unsigned long long hash)
+{
+	for( size_t i = 0; i < s.size(); i++ )
+	{
+		hash ^= (unsigned char)s[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Hash of the current contents of a shader file. Comparing contents rather
+// than modification times catches saves within the same second, and editors
+// that truncate the file before writing it.
+static unsigned long long hashFile(const string &fileName)
+{
+	string contents;
+	readFile(fileName, contents);
+	return hashString(contents, hashSeed);
+}
+
+// Inserts the defines after the #version line (which has to come first in
+// the shader), and resets the line numbering so that compile errors still
+// refer to lines in the file.
+static string injectDefines(const string &source, const string &defines)
+{
+	if( defines.empty() )
+	{
+		return source;
+	}
+	size_t versionPos = source.find("#version");
+	if( versionPos == string::npos )
+	{
+		// No #version means GLSL 1.10, where "#line 0" numbers the next
+		// line 1.
+		return defines + "#line 0\n" + source;
+	}
+	size_t lineEnd = source.find('\n', versionPos);
+	if( lineEnd == string::npos )
+	{
+		return source + "\n" + defines;
+	}
+	int nextLine = 2;
+	for( size_t i = 0; i < lineEnd; i++ )
+	{
+		if( source[i] == '\n' ) nextLine++;
+	}
+	// Before GLSL 3.30, "#line N" numbers the line after the directive
+	// N + 1 rather than N.
+	int version = atoi(source.c_str() + versionPos + strlen("#version"));
+	if( version < 330 )
+	{
+		nextLine--;
+	}
+	char lineDirective[32];
+	sprintf(lineDirective, "#line %d\n", nextLine);
+	return source.substr(0, lineEnd + 1) + defines + lineDirective
+		+ source.substr(lineEnd + 1);
+}
+
+static GLuint compileShader(GLenum type, const string &source,
+	const string &fileName)
+{
+	GLuint shader = glCreateShader(type);
+	const char *src = source.c_str();
+	glShaderSource(shader, 1, &src, 0);
+	glCompileShader(shader);
+
+	GLint compiled = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if( !compiled )
+	{
+		GLint logLength = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+		vector<char> log(logLength + 1, '\0');
+		glGetShaderInfoLog(shader, logLength, 0, &log[0]);
+		printf("Failed to compile %s:\n%s\n", fileName.c_str(), &log[0]);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+static bool checkLinkStatus(GLuint program, const string &name)
+{
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if( !linked )
+	{
+		GLint logLength = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+		vector<char> log(logLength + 1, '\0');
+		glGetProgramInfoLog(program, logLength, 0, &log[0]);
+		printf("Failed to link %s:\n%s\n", name.c_str(), &log[0]);
+		return false;
+	}
+	return true;
+}
+
+//*****************************************************************************
+//	ShaderManager
+//*****************************************************************************
+ShaderManager::ShaderManager()
+	: m_polling(false)
+	, m_lastPollTime(0.0f)
+	, m_binarySupport(-1)
+{
+}
+
+ShaderManager::~ShaderManager()
+{
+	// The GL context may already be gone at this point (glut exits without
+	// returning from the main loop), so the programs are left to the driver.
+}
+
+int ShaderManager::addProgram(const char *vertexFile, const char *fragmentFile,
+	const string &defines, BindLocationsFunc bindLocations)
+{
+	Program p;
+	p.vertexFile = vertexFile;
+	p.fragmentFile = fragmentFile;
+	p.defines = defines;
+	p.bindLocations = bindLocations;
+	p.vertexFileIndex = watchFile(p.vertexFile);
+	p.fragmentFileIndex = watchFile(p.fragmentFile);
+	p.needsRebuild = false;
+	p.program = buildProgram(p);
+
+	m_programs.push_back(p);
+	return int(m_programs.size()) - 1;
+}
+
+GLuint ShaderManager::getProgram(int id) const
+{
+	if( id < 0 || id >= int(m_programs.size()) )
+	{
+		return 0;
+	}
+	return m_programs[id].program;
+}
+
+int ShaderManager::watchFile(const string &name)
+{
+	for( size_t i = 0; i < m_files.size(); i++ )
+	{
+		if( m_files[i].name == name )
+		{
+			return int(i);
+		}
+	}
+	WatchedFile file;
+	file.name = name;
+	file.contentHash = hashFile(name);
+	m_files.push_back(file);
+	return int(m_files.size()) - 1;
+}
+
+// Runs on the job system: hashes every watched file once.
+void ShaderManager::pollFiles(int, void *poll)
+{
+	Poll &p = *(Poll *)poll;
+	for( size_t i = 0; i < p.fileNames.size(); i++ )
+	{
+		p.contentHashes[i] = hashFile(p.fileNames[i]);
+	}
+}
+
+bool ShaderManager::reloadModifiedPrograms(float elapsedSeconds,
+	JobSystem &jobSystem)
+{
+	if( m_polling && jobSystem.isFinished(m_pollJob) )
+	{
+		m_polling = false;
+		for( size_t i = 0; i < m_poll.fileNames.size(); i++ )
+		{
+			if( m_poll.contentHashes[i] == m_files[i].contentHash )
+			{
+				continue;
+			}
+			m_files[i].contentHash = m_poll.contentHashes[i];
+			for( size_t j = 0; j < m_programs.size(); j++ )
+			{
+				Program &p = m_programs[j];
+				if( p.vertexFileIndex == int(i) || p.fragmentFileIndex == int(i) )
+				{
+					p.needsRebuild = true;
+				}
+			}
+		}
+	}
+
+	// Reading the files every frame is wasteful, twice a second is plenty
+	// to make edits show up "immediately".
+	if( !m_polling && elapsedSeconds - m_lastPollTime >= 0.5f )
+	{
+		m_lastPollTime = elapsedSeconds;
+		// The job works on its own copy of the names, so programs can be
+		// added while it runs.
+		m_poll.fileNames.resize(m_files.size());
+		m_poll.contentHashes.resize(m_files.size());
+		for( size_t i = 0; i < m_files.size(); i++ )
+		{
+			m_poll.fileNames[i] = m_files[i].name;
+		}
+		m_pollJob.job = &ShaderManager::pollFiles;
+		m_pollJob.userData = &m_poll;
+		m_polling = true;
+		jobSystem.startBackgroundJob(m_pollJob);
+	}
+
+	// Rebuild one program per call, so that an edit to a file shared by
+	// several programs doesn't stall a single frame with all of them.
+	for( size_t i = 0; i < m_programs.size(); i++ )
+	{
+		Program &p = m_programs[i];
+		if( !p.needsRebuild )
+		{
+			continue;
+		}
+		p.needsRebuild = false;
+
+		printf("Reloading %s / %s\n", p.vertexFile.c_str(),
+			p.fragmentFile.c_str());
+		GLuint program = buildProgram(p);
+		if( program == 0 )
+		{
+			printf("Keeping the previous version of the program.\n");
+			return false;
+		}
+		glDeleteProgram(p.program);
+		p.program = program;
+		return true;
+	}
+	return false;
+}
+
+GLuint ShaderManager::buildProgram(const Program &p)
+{
+	string vertexSource, fragmentSource;
+	if( !readFile(p.vertexFile, vertexSource) )
+	{
+		printf("Failed to read %s\n", p.vertexFile.c_str());
+		return 0;
+	}
+	if( !readFile(p.fragmentFile, fragmentSource) )
+	{
+		printf("Failed to read %s\n", p.fragmentFile.c_str());
+		return 0;
+	}
+	vertexSource = injectDefines(vertexSource, p.defines);
+	fragmentSource = injectDefines(fragmentSource, p.defines);
+	string name = p.vertexFile + " / " + p.fragmentFile;
+
+	// Try the binary cache first. The file name only depends on which
+	// program it is, so that a rebuild after an edit replaces the old entry;
+	// the key stored in the file says which sources it was built from.
+	unsigned long long key = hashSeed;
+	string cacheFile;
+	if( binariesSupported() )
+	{
+		key = hashString(shaderCacheVersion, key);
+		key = hashString(m_driverString, key);
+		key = hashString(vertexSource, key);
+		key = hashString(fragmentSource, key);
+
+		unsigned long long nameKey = hashString(p.vertexFile, hashSeed);
+		nameKey = hashString("|", nameKey);
+		nameKey = hashString(p.fragmentFile, nameKey);
+		nameKey = hashString("|", nameKey);
+		nameKey = hashString(p.defines, nameKey);
+
+		char fileName[64];
+		sprintf(fileName, "shadercache_%08x%08x.bin",
+			unsigned(nameKey >> 32), unsigned(nameKey & 0xffffffffu));
+		cacheFile = fileName;
+
+		GLuint program = loadProgramBinary(cacheFile, key);
+		if( program != 0 )
+		{
+			return program;
+		}
+	}
+
+	// Otherwise, compile and link from source.
+	GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource,
+		p.vertexFile);
+	GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource,
+		p.fragmentFile);
+	if( vertexShader == 0 || fragmentShader == 0 )
+	{
+		glDeleteShader(vertexShader);
+		glDeleteShader(fragmentShader);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+	if( p.bindLocations )
+	{
+		p.bindLocations(program);
+	}
+	if( !cacheFile.empty() )
+	{
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+			GL_TRUE);
+	}
+	glLinkProgram(program);
+
+	glDetachShader(program, vertexShader);
+	glDetachShader(program, fragmentShader);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	if( !checkLinkStatus(program, name) )
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	if( !cacheFile.empty() )
+	{
+		saveProgramBinary(cacheFile, key, program);
+	}
+	return program;
+}
+
+/* Cache file layout: the 64 bit key, the binary format enum, the length of
+ * the binary and then the binary itself. A file whose key doesn't match is
+ * stale (the sources or the driver changed) and gets overwritten.
+ */
+GLuint ShaderManager::loadProgramBinary(const string &cacheFile,
+	unsigned long long key)
+{
+	FILE *file = fopen(cacheFile.c_str(), "rb");
+	if( !file )
+	{
+		return 0;
+	}
+
+	unsigned long long storedKey = 0;
+	GLenum format = 0;
+	GLint length = 0;
+	bool ok = fread(&storedKey, sizeof(storedKey), 1, file) == 1
+		&& fread(&format, sizeof(format), 1, file) == 1
+		&& fread(&length, sizeof(length), 1, file) == 1
+		&& storedKey == key && length > 0;
+	vector<char> binary;
+	if( ok )
+	{
+		binary.resize(length);
+		ok = fread(&binary[0], 1, length, file) == size_t(length);
+	}
+	fclose(file);
+	if( !ok )
+	{
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, &binary[0], length);
+
+	// The driver is free to reject binaries (e.g., after an update), in which
+	// case we simply compile from source again.
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if( !linked )
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+void ShaderManager::saveProgramBinary(const string &cacheFile,
+	unsigned long long key, GLuint program)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if( length <= 0 )
+	{
+		return;
+	}
+	vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, 0, &format, &binary[0]);
+
+	FILE *file = fopen(cacheFile.c_str(), "wb");
+	if( !file )
+	{
+		return;
+	}
+	fwrite(&key, sizeof(key), 1, file);
+	fwrite(&format, sizeof(format), 1, file);
+	fwrite(&length, sizeof(length), 1, file);
+	fwrite(&binary[0], 1, length, file);
+	fclose(file);
+}
+
+bool ShaderManager::binariesSupported()
+{
+	if( m_binarySupport < 0 )
+	{
+		GLint numFormats = 0;
+		if( GLEW_ARB_get_program_binary || GLEW_VERSION_4_1 )
+		{
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+		}
+		m_binarySupport = numFormats > 0 ? 1 : 0;
+
+		// Binaries are only valid for the driver that produced them, so the
+		// driver identification goes into the cache key.
+		const char *vendor = (const char *)glGetString(GL_VENDOR);
+		const char *renderer = (const char *)glGetString(GL_RENDERER);
+		const char *version = (const char *)glGetString(GL_VERSION);
+		m_driverString = string(vendor ? vendor : "") + "|"
+			+ (renderer ? renderer : "") + "|" + (version ? version : "");
+	}
+	return m_binarySupport == 1;
+}
@@ -0,0 +1,101 @@
+#ifndef SHADER_MANAGER_H
+#define SHADER_MANAGER_H
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+
+#include "JobSystem.h"
+
+/* Owns the shader programs used by the project. A program is built from a
+ * vertex shader file, a fragment shader file and a block of #defines (a
+ * permutation), so the same source can be compiled with features switched
+ * on and off.
+ *
+ * When the driver supports program binaries, linked programs are written to
+ * disk, one file per program (file names and defines). The file also holds a
+ * hash of the sources, the defines and the driver strings; if that matches,
+ * later runs load the binary instead of compiling from source.
+ *
+ * The shader files are also watched for changes; a program whose sources
+ * are modified is rebuilt in place. If the new version fails to compile or
+ * link, the old program is kept. Since the GL name of a program changes on
+ * reload, always look it up with getProgram() rather than storing it.
+ *
+ * Reading and hashing the files to spot edits runs as a background job.
+ * Rebuilding needs the GL context, so it happens on the calling (GLUT)
+ * thread; at most one program is rebuilt per call to spread the cost over
+ * several frames.
+ */
+class ShaderManager
+{
+public:
+	// Called on a freshly created program, before it is linked. Use it to
+	// bind attribute and frag data locations.
+	typedef void (*BindLocationsFunc)(GLuint program);
+
+	ShaderManager();
+	~ShaderManager();
+
+	// Builds a program and returns its id. The id is valid even if the
+	// build fails (getProgram() returns 0 until a reload succeeds).
+	int addProgram(const char *vertexFile, const char *fragmentFile,
+		const std::string &defines, BindLocationsFunc bindLocations);
+
+	GLuint getProgram(int id) const;
+
+	// Checks (at most a couple of times per second, in the background) if
+	// any shader file has been modified, and rebuilds one of the affected
+	// programs. Call it every frame. Returns true if a program was replaced.
+	bool reloadModifiedPrograms(float elapsedSeconds, JobSystem &jobSystem);
+
+private:
+	struct Program
+	{
+		std::string vertexFile;
+		std::string fragmentFile;
+		std::string defines;
+		BindLocationsFunc bindLocations;
+		int vertexFileIndex;		// Into m_files
+		int fragmentFileIndex;
+		bool needsRebuild;
+		GLuint program;
+	};
+
+	// A shader file used by one or more programs.
+	struct WatchedFile
+	{
+		std::string name;
+		unsigned long long contentHash;
+	};
+
+	// Input and output of the background poll. Only touched by the poll job
+	// while it is running.
+	struct Poll
+	{
+		std::vector<std::string> fileNames;
+		std::vector<unsigned long long> contentHashes;
+	};
+
+	static void pollFiles(int, void *poll);
+	int watchFile(const std::string &name);
+
+	GLuint buildProgram(const Program &p);
+	GLuint loadProgramBinary(const std::string &cacheFile,
+		unsigned long long key);
+	void saveProgramBinary(const std::string &cacheFile, unsigned long long key,
+		GLuint program);
+	bool binariesSupported();
+
+	std::vector<Program> m_programs;
+	std::vector<WatchedFile> m_files;
+	Poll m_poll;
+	JobSystem::BackgroundJob m_pollJob;
+	bool m_polling;
+	std::string m_driverString;
+	float m_lastPollTime;
+	int m_binarySupport;	// -1 = not yet checked
+};
+
+#endif // SHADER_MANAGER_H
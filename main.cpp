@@ -10,13 +10,20 @@
 #include <IL/ilut.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <algorithm>
+#include <vector>
 
 #include <OBJModel.h>
 #include <glutil.h>
 #include <float4x4.h>
 #include <float3x3.h>
 
+#include "ShaderManager.h"
+#include "Replay.h"
+#include "JobSystem.h"
+#include "DrawList.h"
+
 using namespace std;
 using namespace chag;
 
@@ -25,7 +32,6 @@ using namespace chag;
 //*****************************************************************************
 bool paused = false;				// Tells us wether sun animation is paused
 float currentTime = 0.0f;		// Tells us the current time
-GLuint shaderProgram;
 const float3 up = {0.0f, 1.0f, 0.0f};
 
 //*****************************************************************************
@@ -59,8 +65,16 @@ bool rightDown = false;
 int prev_x = 0;
 int prev_y = 0;
 
-// Shader used to draw the shadow map (and some other simple objects)
-GLuint basicShaderProgram;
+//*****************************************************************************
+//	Shader programs. These are owned by the shader manager, and may be
+//	replaced when the shader files are modified, so look up the GL program
+//	with shaderManager.getProgram() where it is used.
+//*****************************************************************************
+ShaderManager shaderManager;
+int sceneShader;		// simple.vert/frag with reflections
+int cubeMapShader;		// simple.vert/frag without reflections
+int basicShader;		// Used to draw the shadow map
+
 GLuint shadowMapTexture;
 GLuint shadowMapFBO;
 GLuint cubeMapTexture;
@@ -72,6 +86,66 @@ float4x4 lightProjMatrix;
 
 GLuint cubeMapFBO;
 GLuint cubeMapDepth;
+const int cubeMapResolution = 128;
+
+//*****************************************************************************
+//	Scene description, and the draw lists built from it every frame
+//*****************************************************************************
+enum RenderPass
+{
+	SHADOW_PASS = 1 << 0,
+	CUBE_MAP_PASS = 1 << 1,
+	MAIN_PASS = 1 << 2
+};
+
+struct SceneObject
+{
+	OBJModel *model;
+	float4x4 modelMatrix;
+	float reflectiveness;
+	unsigned passes;		// The RenderPass:es the object is drawn in
+	bool sky;				// Blended without depth writes, after the rest
+	bool fadesWithDaylight;	// Alpha follows the sun (the day skybox)
+};
+std::vector<SceneObject> scene;
+
+// One draw list per view rendered each frame: the shadow map, the six cube
+// map faces and the main view. They are kept between frames so that the
+// command vectors don't have to be reallocated.
+const int numCubeMapFaces = 6;
+const int shadowMapList = 0;
+const int firstCubeMapList = 1;
+const int mainList = firstCubeMapList + numCubeMapFaces;
+const int numDrawLists = mainList + 1;
+DrawList drawLists[numDrawLists];
+
+// Below this many commands in total, building the draw lists is cheaper
+// than waking up worker threads for it.
+const size_t minCommandsForParallelBuild = 2048;
+
+// Created on first use rather than as a global, so that no threads are
+// started during static initialisation.
+JobSystem &getJobSystem()
+{
+	static JobSystem jobSystem;
+	return jobSystem;
+}
+
+//*****************************************************************************
+//	Replay capture and playback (started from the command line, see main())
+//*****************************************************************************
+ReplayWriter replayWriter;
+ReplayReader replayReader;
+bool headless = false;					// Playback without showing the window
+std::vector<double> replayFrameTimes;	// In milliseconds
+int replaySkippedFrames = 0;			// Rendered, but not timed
+
+// Offscreen target for the main view when running headless
+GLuint headlessFBO = 0;
+GLuint headlessColor = 0;
+GLuint headlessDepth = 0;
+int headlessWidth = 0;
+int headlessHeight = 0;
 
 
 // Helper function to turn spherical coordinates into cartesian (x,y,z)
@@ -82,6 +156,36 @@ float3 sphericalToCartesian(float theta, float phi, float r)
 						r * cosf(theta)*sinf(phi) );
 }
 
+// Opacity of the day skybox, fading into the night one as the sun sets.
+float dayAlpha()
+{
+	return max<float>(0.0f, cosf((currentTime / 20.0f) * 2.0f * M_PI));
+}
+
+void addSceneObject(OBJModel *model, const float4x4 &modelMatrix,
+	unsigned passes, float reflectiveness = 0.0f, bool sky = false,
+	bool fadesWithDaylight = false)
+{
+	SceneObject object = { model, modelMatrix, reflectiveness, passes, sky,
+		fadesWithDaylight };
+	scene.push_back(object);
+}
+
+
+void bindSimpleShaderLocations(GLuint program)
+{
+	glBindAttribLocation(program, 0, "position"); 	
+	glBindAttribLocation(program, 2, "texCoordIn");
+	glBindAttribLocation(program, 1, "normalIn");
+	glBindFragDataLocation(program, 0, "fragmentColor");
+}
+
+void bindBasicShaderLocations(GLuint program)
+{
+	glBindAttribLocation(program, 0, "position");
+	glBindFragDataLocation(program, 0, "fragmentColor");
+}
+
 
 void initGL()
 {
@@ -117,18 +221,14 @@ void initGL()
 	//*************************************************************************
 	//	Load shaders
 	//*************************************************************************
-	shaderProgram = loadShaderProgram("simple.vert", "simple.frag");
-	glBindAttribLocation(shaderProgram, 0, "position"); 	
-	glBindAttribLocation(shaderProgram, 2, "texCoordIn");
-	glBindAttribLocation(shaderProgram, 1, "normalIn");
-	glBindFragDataLocation(shaderProgram, 0, "fragmentColor");
-	linkShaderProgram(shaderProgram);
-
+	sceneShader = shaderManager.addProgram("simple.vert", "simple.frag",
+		"#define USE_REFLECTION\n", bindSimpleShaderLocations);
+	// The cube map pass must not sample the cube map it is rendering to.
+	cubeMapShader = shaderManager.addProgram("simple.vert", "simple.frag",
+		"", bindSimpleShaderLocations);
 
-	basicShaderProgram = loadShaderProgram("basic.vert", "basic.frag");
-	glBindAttribLocation(basicShaderProgram, 0, "position");
-	glBindFragDataLocation(basicShaderProgram, 0, "fragmentColor");
-	linkShaderProgram(basicShaderProgram);
+	basicShader = shaderManager.addProgram("basic.vert", "basic.frag", "",
+		bindBasicShaderLocations);
 
 	//*************************************************************************
 	// Load the models from disk
@@ -153,13 +253,24 @@ void initGL()
 	car = new OBJModel(); 
 	car->load("../scenes/car.obj");
 
+	addSceneObject(water, make_translation(make_vector(0.0f, -6.0f, 0.0f)),
+		CUBE_MAP_PASS | MAIN_PASS);
+	addSceneObject(world, make_identity<float4x4>(),
+		SHADOW_PASS | CUBE_MAP_PASS | MAIN_PASS);
+	addSceneObject(car, make_translation(make_vector(0.0f, 0.0f, 0.0f)),
+		SHADOW_PASS | MAIN_PASS, 0.5f);
+	addSceneObject(skyboxnight, make_identity<float4x4>(),
+		CUBE_MAP_PASS | MAIN_PASS, 0.0f, true);
+	addSceneObject(skybox, make_identity<float4x4>(),
+		CUBE_MAP_PASS | MAIN_PASS, 0.0f, true, true);
+
 
 	//Cube map
 	glGenTextures(1, &cubeMapTexture);
 	glActiveTexture(GL_TEXTURE2);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMapTexture);
 
-	const int size = 128;
+	const int size = cubeMapResolution;
 	// create the fbo
 	glGenFramebuffers(1, &cubeMapFBO);
 	glBindFramebuffer(GL_FRAMEBUFFER, cubeMapFBO);
@@ -246,272 +357,301 @@ void initGL()
 		"cube2.png", "cube3.png",
 		"cube4.png", "cube5.png");
 		*/
+	GLuint shaderProgram = shaderManager.getProgram(sceneShader);
 	glUseProgram(shaderProgram);
 	setUniformSlow(shaderProgram, "environmentMap", 2);
 
 }
 
 
-void drawModel(OBJModel *model, const float4x4 &modelMatrix)
+// Appends the commands for the scene objects drawn in 'pass'. Sky objects
+// are blended, so they go last.
+void addSceneCommands(DrawList &list, unsigned pass, float dayAlpha)
 {
-	GLint currentProgram;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
-
-	setUniformSlow(currentProgram, "modelMatrix", modelMatrix);
-	model->render();
+	list.commands.clear();
+	for (size_t i = 0; i < scene.size(); i++)
+	{
+		const SceneObject &object = scene[i];
+		if ((object.passes & pass) && !object.sky)
+		{
+			DrawCommand command = { object.model, object.modelMatrix,
+				object.reflectiveness, 1.0f, false };
+			list.commands.push_back(command);
+		}
+	}
+	for (size_t i = 0; i < scene.size(); i++)
+	{
+		const SceneObject &object = scene[i];
+		if ((object.passes & pass) && object.sky)
+		{
+			float alpha = object.fadesWithDaylight ? dayAlpha : 1.0f;
+			DrawCommand command = { object.model, object.modelMatrix,
+				object.reflectiveness, alpha, true };
+			list.commands.push_back(command);
+		}
+	}
 }
 
-/**
-* In this function, add all scene elements that should cast shadow, that way
-* there is only one draw call to each of these, as this function is called twice.
-*/
-void drawShadowCasters()
+// Per-pass uniforms for passes that use simple.vert/simple.frag.
+PassUniforms cameraPassUniforms(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
 {
-	GLint currentProgram;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+	PassUniforms u;
+	u.viewMatrix = viewMatrix;
+	u.inverseViewNormalMatrix = transpose(viewMatrix);
+	u.projectionMatrix = projectionMatrix;
+	u.lightMatrix = lightProjMatrix * lightViewMatrix * inverse(viewMatrix);
+	u.lightpos = lightPosition;
+	u.viewSpaceLightDir = transformDirection(viewMatrix, -normalize(lightPosition));
+	return u;
+}
 
-	drawModel(world, make_identity<float4x4>());
-	setUniformSlow(currentProgram, "object_reflectiveness", 0.5f);
-	drawModel(car, make_translation(make_vector(0.0f, 0.0f, 0.0f)));
-	setUniformSlow(currentProgram, "object_reflectiveness", 0.0f);
+/* The build*List() functions run on the job system, so they must not make
+ * any GL calls. They only read state that stays constant while the lists
+ * are being built.
+ */
+void buildShadowMapList(DrawList &list)
+{
+	list.program = shaderManager.getProgram(basicShader);
+	list.framebuffer = shadowMapFBO;
+	list.cubeMapFace = 0;
+	list.colorCubeMap = 0;
+	list.viewportWidth = shadowMapResolution;
+	list.viewportHeight = shadowMapResolution;
+	list.clearColor = make_vector(1.0f, 1.0f, 1.0f, 1.0f);
+	list.polygonOffset = true;
+	list.shadowMap = 0;
+	list.environmentMap = 0;
+
+	list.uniforms.viewMatrix = lightViewMatrix;
+	list.uniforms.projectionMatrix = lightProjMatrix;
+	list.uniforms.inverseViewNormalMatrix = make_identity<float4x4>();
+	list.uniforms.lightMatrix = make_identity<float4x4>();
+	list.uniforms.lightpos = lightPosition;
+	list.uniforms.viewSpaceLightDir = make_vector(0.0f, 0.0f, 0.0f);
+
+	addSceneCommands(list, SHADOW_PASS, 1.0f);
 }
 
-void drawScene(void)
+void buildCubeMapFaceList(int face, DrawList &list)
 {
-	glEnable(GL_DEPTH_TEST);	// enable Z-buffering 
+	// The faces in GL order (+X, -X, +Y, -Y, +Z, -Z), seen from just above
+	// the origin.
+	static const GLenum faceTargets[numCubeMapFaces] = {
+		GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
+		GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
+		GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
+	};
+	static const float3 faceDirections[numCubeMapFaces] = {
+		{ 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f },
+		{ 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+	};
+	static const float3 faceUps[numCubeMapFaces] = {
+		{ 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, 1.0f },
+		{ 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+	};
+
+	list.program = shaderManager.getProgram(cubeMapShader);
+	list.framebuffer = cubeMapFBO;
+	list.cubeMapFace = faceTargets[face];
+	list.colorCubeMap = cubeMapTexture;
+	list.viewportWidth = cubeMapResolution;
+	list.viewportHeight = cubeMapResolution;
+	list.clearColor = make_vector(1.0f, 1.0f, 1.0f, 1.0f);
+	list.polygonOffset = false;
+	list.shadowMap = shadowMapTexture;
+	// The cube map is the render target here, so it can't be sampled.
+	list.environmentMap = 0;
+
+	float cameraYOffset = 1.0f;
+	float3 camera_position = make_vector(0.0f, cameraYOffset, 0.0f);
+	float4x4 viewMatrix = lookAt(camera_position,
+		camera_position + faceDirections[face], faceUps[face]);
+	float4x4 projectionMatrix = perspectiveMatrix(90.0f, 1.0f, 0.1f, 1000.0f);
+	list.uniforms = cameraPassUniforms(viewMatrix, projectionMatrix);
+
+	addSceneCommands(list, CUBE_MAP_PASS, dayAlpha());
+}
 
-	// enable back face culling.
-	glEnable(GL_CULL_FACE);	
+void buildMainList(DrawList &list, int w, int h)
+{
+	list.program = shaderManager.getProgram(sceneShader);
+	list.framebuffer = headless ? headlessFBO : 0;
+	list.cubeMapFace = 0;
+	list.colorCubeMap = 0;
+	list.viewportWidth = w;
+	list.viewportHeight = h;
+	list.clearColor = make_vector(0.2f, 0.2f, 0.8f, 1.0f);
+	list.polygonOffset = false;
+	list.shadowMap = shadowMapTexture;
+	list.environmentMap = cubeMapTexture;
 
-	//*************************************************************************
-	// Render the scene from the cameras viewpoint, to the default framebuffer
-	//*************************************************************************
-	glClearColor(0.2,0.2,0.8,1.0);						
-	glClearDepth(1);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); 
-	int w = glutGet((GLenum)GLUT_WINDOW_WIDTH);
-	int h = glutGet((GLenum)GLUT_WINDOW_HEIGHT);
-	glViewport(0, 0, w, h);								
-	// Use shader and set up uniforms
-	glUseProgram( shaderProgram );			
 	float3 camera_position = sphericalToCartesian(camera_theta, camera_phi, camera_r);
 	float3 camera_lookAt = make_vector(0.0f, camera_target_altitude, 0.0f);
 	float3 camera_up = make_vector(0.0f, 1.0f, 0.0f);
 	float4x4 viewMatrix = lookAt(camera_position, camera_lookAt, camera_up);
 	float4x4 projectionMatrix = perspectiveMatrix(45.0f, float(w) / float(h), 0.1f, 1000.0f);
-	setUniformSlow(shaderProgram, "viewMatrix", viewMatrix);
-	setUniformSlow(shaderProgram, "inverseViewNormalMatrix",
-		transpose(viewMatrix));
-	setUniformSlow(shaderProgram, "projectionMatrix", projectionMatrix);
-	setUniformSlow(shaderProgram, "lightpos", lightPosition); 
-
-	float4x4 lightMatrix = lightProjMatrix * lightViewMatrix * inverse(viewMatrix);
-
-	setUniformSlow(shaderProgram, "lightMatrix", lightMatrix);
-
-
-	drawModel(water, make_translation(make_vector(0.0f, -6.0f, 0.0f)));
-
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
-	setUniformSlow(shaderProgram, "shadowMap", 1);
-
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMapTexture);
-	setUniformSlow(shaderProgram, "environmentMap", 2);
-
-	float3 viewSpaceLightDir = transformDirection(
-		viewMatrix, -normalize(lightPosition));
-	setUniformSlow(shaderProgram, "viewSpaceLightDir", viewSpaceLightDir);
+	list.uniforms = cameraPassUniforms(viewMatrix, projectionMatrix);
 
+	addSceneCommands(list, MAIN_PASS, dayAlpha());
+}
 
 
-	drawShadowCasters();
 
-	glDepthMask(GL_FALSE);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	drawModel(skyboxnight, make_identity<float4x4>());
-	setUniformSlow(shaderProgram, "object_alpha", max<float>(0.0f, cosf((currentTime / 20.0f) * 2.0f * M_PI))); 
-	drawModel(skybox, make_identity<float4x4>());
-	setUniformSlow(shaderProgram, "object_alpha", 1.0f); 
-	glDisable(GL_BLEND);
-	glDepthMask(GL_TRUE); 
+void updateLight()
+{
+	// rotate light around X axis, sunlike fashion.
+	// do one full revolution every 20 seconds.
+	float4x4 rotateLight = make_rotation_x<float4x4>(2.0f * M_PI * currentTime / 20.0f);
+	// rotate and update global light position.
+	lightPosition = make_vector3(rotateLight * make_vector(30.1f, 450.0f, 0.1f, 1.0f));
 
-	glUseProgram( 0 );	
+	lightViewMatrix = lookAt(lightPosition, make_vector(0.0f, 0.0f, 0.0f), make_vector(0.0f, 1.0f, 0.0f));
 }
 
-void drawShadowMap()
-{
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO),
-	glViewport(0, 0, shadowMapResolution, shadowMapResolution);
 
-	glClearColor(1.0, 1.0, 1.0, 1.0);
-	glClearDepth(1.0);
-	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+// (Re)creates the offscreen target used instead of the window when headless.
+void resizeHeadlessTarget(int w, int h)
+{
+	if (headlessFBO != 0 && w == headlessWidth && h == headlessHeight)
+		return;
 
-	glEnable(GL_POLYGON_OFFSET_FILL);
-	glPolygonOffset(1.0, 2);
+	if (headlessFBO == 0)
+	{
+		glGenFramebuffers(1, &headlessFBO);
+		glGenRenderbuffers(1, &headlessColor);
+		glGenRenderbuffers(1, &headlessDepth);
+	}
+	glBindRenderbuffer(GL_RENDERBUFFER, headlessColor);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, headlessDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, headlessFBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_RENDERBUFFER, headlessColor);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		GL_RENDERBUFFER, headlessDepth);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Headless render target (%d x %d) is incomplete: 0x%x\n", w, h, status);
+		exit(1);
+	}
 
-	// Get current shader, so we can restore it afterwards. Also, switch to
-	// the simple shader used to draw the shadow map.
-	GLint currentProgram;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
-	glUseProgram(basicShaderProgram);
+	headlessWidth = w;
+	headlessHeight = h;
+}
 
-	setUniformSlow(basicShaderProgram, "projectionMatrix", lightProjMatrix);
-	setUniformSlow(basicShaderProgram, "viewMatrix", lightViewMatrix);
-	// draw shadow casters
-	drawShadowCasters();
 
-	// Restore old shader
-	glUseProgram(currentProgram);
+// Job for the job system: builds draw list i for the ReplayFrame in 'data'.
+void buildDrawList(int i, void *data)
+{
+	const ReplayFrame &frame = *(const ReplayFrame *)data;
+	if (i == shadowMapList)
+		buildShadowMapList(drawLists[i]);
+	else if (i == mainList)
+		buildMainList(drawLists[i], frame.width, frame.height);
+	else
+		buildCubeMapFaceList(i - firstCubeMapList, drawLists[i]);
+}
 
-	glDisable(GL_POLYGON_OFFSET_FILL);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+// Called when the last frame of a replay has been rendered.
+void finishPlayback()
+{
+	if (replaySkippedFrames > 0)
+	{
+		printf("Skipped %d frames while the window was being resized.\n",
+			replaySkippedFrames);
+	}
+	printFrameTimeStatistics(replayFrameTimes);
+	exit(0);
 }
 
 
-void drawCubeMap()
-{
-	
-	glBindFramebuffer(GL_FRAMEBUFFER, cubeMapFBO);
-	glViewport(0, 0, 128, 128);
+void display(void)
+{	
+	double frameStart = replayTimerMilliseconds();
 
-	glClearColor(1.0, 1.0, 1.0, 1.0);
-	glClearDepth(1.0);
-	glEnable(GL_DEPTH_TEST);// enable Z-buffering
-	glEnable(GL_CULL_FACE);// enable back face culling.
-	
-	glUseProgram(shaderProgram);
-	
-	for (int i = 0; i<6; i++)
+	ReplayFrame frame;
+	bool timeFrame = replayReader.isOpen();
+	if (replayReader.isOpen())
 	{
-		if (i == 0) { //X+
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				GL_TEXTURE_CUBE_MAP_POSITIVE_X, cubeMapTexture, 0);
-		}
-		else if (i == 1) { //X-
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				GL_TEXTURE_CUBE_MAP_NEGATIVE_X, cubeMapTexture, 0);
-		}
-		else if (i == 2) {//Y+
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				GL_TEXTURE_CUBE_MAP_POSITIVE_Y, cubeMapTexture, 0);
-		}
-		else if (i == 3) {//....
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, cubeMapTexture, 0);
-		}
-		else if (i == 4) {
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				GL_TEXTURE_CUBE_MAP_POSITIVE_Z, cubeMapTexture, 0);
-		}
-		else if (i == 5) {
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, cubeMapTexture, 0);
+		// Playback: the capture decides everything that affects the frame.
+		if (!replayReader.readFrame(frame))
+		{
+			finishPlayback();
 		}
-		
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		float cameraYOffset = 1.0f;
-		float3 camera_position = make_vector(0.0f, cameraYOffset, 0.0f);
-		float3 camera_lookAt, camera_up;
-		float4x4 viewMatrix;
-		if (i == 0) { //X+
-			//cam->Update(vec3(0), vec3(10, 0, 0)); // position, target
-
-			camera_up = make_vector(0.0f, -1.0f, 0.0f);
-			camera_lookAt = make_vector(1.0f, cameraYOffset, 0.0f);
-			viewMatrix = lookAt(camera_position, camera_lookAt, camera_up);
+		camera_theta = frame.cameraTheta;
+		camera_phi = frame.cameraPhi;
+		camera_r = frame.cameraR;
+		camera_target_altitude = frame.cameraTargetAltitude;
+		currentTime = frame.currentTime;
+		paused = frame.paused;
+		if (headless)
+		{
+			resizeHeadlessTarget(frame.width, frame.height);
 		}
-		else if (i == 1) { //X-
-			//cam->Update(vec3(0), vec3(-10, 0, 0));
-			camera_up = make_vector(0.0f, -1.0f, 0.0f);
-			camera_lookAt = make_vector(-1.0f, cameraYOffset, 0.0f);
-			viewMatrix = lookAt(camera_position, camera_lookAt, camera_up);
+		else if (frame.width != glutGet((GLenum)GLUT_WINDOW_WIDTH)
+			|| frame.height != glutGet((GLenum)GLUT_WINDOW_HEIGHT))
+		{
+			// The window was resized during the capture. Resizing is
+			// asynchronous, so leave frames out of the statistics until the
+			// window has the recorded size.
+			glutReshapeWindow(frame.width, frame.height);
+			timeFrame = false;
+			replaySkippedFrames++;
 		}
-		else if (i == 2) {//Y+
-			//cam->Update(vec3(0), vec3(0, 10, 0));
-			camera_up = make_vector(0.0f, 0.0f, 1.0f);
-			camera_lookAt = make_vector(0.0f, 1.0f + cameraYOffset, 0.0f);
-			viewMatrix = lookAt(camera_position, camera_lookAt, camera_up);
-		}
-		else if (i == 3) {//....
-			//cam->Update(vec3(0), vec3(0, -10, 0));
-			camera_up = make_vector(0.0f, 0.0f, 1.0f);
-			camera_lookAt = make_vector(0.0f, -1.0f + cameraYOffset, 0.0f);
-			viewMatrix = lookAt(camera_position, camera_lookAt, camera_up);
-		}
-		else if (i == 4) {
-			//cam->Update(vec3(0), vec3(0, 0, 10));
-			camera_up = make_vector(0.0f, -1.0f, 0.0f);
-			camera_lookAt = make_vector(0.0f, cameraYOffset, 1.0f);
-			viewMatrix = lookAt(camera_position, camera_lookAt, camera_up);
-		}
-		else if (i == 5) {
-			//cam->Update(vec3(0), vec3(0, 0, -10));
-			camera_up = make_vector(0.0f, -1.0f, 0.0f);
-			camera_lookAt = make_vector(0.0f, cameraYOffset, -1.0f);
-			viewMatrix = lookAt(camera_position, camera_lookAt, camera_up);
-		}
-		
-		float4x4 projectionMatrix = perspectiveMatrix(90.0f, 1.0f, 0.1f, 1000.0f);
-		setUniformSlow(shaderProgram, "viewMatrix", viewMatrix);
-		setUniformSlow(shaderProgram, "inverseViewNormalMatrix",
-			transpose(viewMatrix));
-		setUniformSlow(shaderProgram, "projectionMatrix", projectionMatrix);
-		setUniformSlow(shaderProgram, "lightpos", lightPosition);
-
-		float4x4 lightMatrix = lightProjMatrix * lightViewMatrix * inverse(viewMatrix);
-
-		setUniformSlow(shaderProgram, "lightMatrix", lightMatrix);
-
-		drawModel(water, make_translation(make_vector(0.0f, -6.0f, 0.0f)));
-
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
-		setUniformSlow(shaderProgram, "shadowMap", 1);
-
-		float3 viewSpaceLightDir = transformDirection(
-			viewMatrix, -normalize(lightPosition));
-		setUniformSlow(shaderProgram, "viewSpaceLightDir", viewSpaceLightDir);
-
-		drawModel(world, make_identity<float4x4>());
-		
-		glDepthMask(GL_FALSE);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		drawModel(skyboxnight, make_identity<float4x4>());
-		setUniformSlow(shaderProgram, "object_alpha", max<float>(0.0f, cosf((currentTime / 20.0f) * 2.0f * M_PI)));
-		drawModel(skybox, make_identity<float4x4>());
-		setUniformSlow(shaderProgram, "object_alpha", 1.0f);
-		glDisable(GL_BLEND);
-		glDepthMask(GL_TRUE);
-		
-		
+	}
+	else
+	{
+		frame.cameraTheta = camera_theta;
+		frame.cameraPhi = camera_phi;
+		frame.cameraR = camera_r;
+		frame.cameraTargetAltitude = camera_target_altitude;
+		frame.currentTime = currentTime;
+		frame.width = glutGet((GLenum)GLUT_WINDOW_WIDTH);
+		frame.height = glutGet((GLenum)GLUT_WINDOW_HEIGHT);
+		frame.paused = paused;
+		replayWriter.writeFrame(frame);
 	}
 
-	glUseProgram(0);
-
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-
-
-void display(void)
-{	
 	// construct light matrices
-	drawShadowMap();
-	
-	drawCubeMap();
+	updateLight();
 
-	drawScene();
-	glutSwapBuffers();  // swap front and back buffer. This frame will now be displayed.
+	// Prepare the draw lists for all views (in parallel, for large scenes),
+	// then issue them in order from this thread, which owns the GL context.
+	if (scene.size() * numDrawLists >= minCommandsForParallelBuild)
+	{
+		getJobSystem().parallelFor(numDrawLists, buildDrawList, &frame);
+	}
+	else
+	{
+		for (int i = 0; i < numDrawLists; i++)
+		{
+			buildDrawList(i, &frame);
+		}
+	}
+	for (int i = 0; i < numDrawLists; i++)
+	{
+		executeDrawList(drawLists[i]);
+	}
+	if (!headless)
+	{
+		glutSwapBuffers();  // swap front and back buffer. This frame will now be displayed.
+	}
 	CHECK_GL_ERROR();
+
+	if (timeFrame)
+	{
+		// Wait for the GPU, so that the frame time covers all of the work.
+		glFinish();
+		replayFrameTimes.push_back(replayTimerMilliseconds() - frameStart);
+	}
 }
 
 
@@ -613,13 +753,20 @@ void idle( void )
 		currentTime = float(glutGet(GLUT_ELAPSED_TIME)) / 1000.0f - startTime;
 	}
 
-	// rotate light around X axis, sunlike fashion.
-	// do one full revolution every 20 seconds.
-	float4x4 rotateLight = make_rotation_x<float4x4>(2.0f * M_PI * currentTime / 20.0f);
-	// rotate and update global light position.
-	lightPosition = make_vector3(rotateLight * make_vector(30.1f, 450.0f, 0.1f, 1.0f));
+	// Pick up any edits to the shader files.
+	if (shaderManager.reloadModifiedPrograms(float(glutGet(GLUT_ELAPSED_TIME)) / 1000.0f,
+		getJobSystem()))
+	{
+		clearUniformLocationCache();
+	}
 
-	lightViewMatrix = lookAt(lightPosition, make_vector(0.0f, 0.0f, 0.0f), make_vector(0.0f, 1.0f, 0.0f));
+	if (headless)
+	{
+		// freeglut never calls the display callback for a hidden window, so
+		// headless playback renders its frames from here.
+		display();
+		return;
+	}
 
 	glutPostRedisplay();  
 	// Uncommenting the line above tells glut that the window 
@@ -635,8 +782,57 @@ int main(int argc, char *argv[])
 
 	glutInit(&argc, argv);
 
+	/* Replay options (glutInit() has already removed the arguments it knows):
+	 *
+	 *   --record <file>   write the per-frame inputs to <file>
+	 *   --replay <file>   render the frames in <file> as fast as possible,
+	 *                     then print frame time statistics and exit
+	 *   --headless        with --replay, render offscreen with the window
+	 *                     hidden
+	 */
+	const char *recordFile = 0;
+	const char *replayFile = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			recordFile = argv[++i];
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replayFile = argv[++i];
+		else if (strcmp(argv[i], "--headless") == 0)
+			headless = true;
+		else
+			printf("Unknown argument: %s\n", argv[i]);
+	}
+	if (replayFile)
+	{
+		if (!replayReader.open(replayFile))
+			return 1;
+	}
+	else if (recordFile)
+	{
+		if (!replayWriter.open(recordFile))
+			return 1;
+	}
+	if (!replayReader.isOpen())
+	{
+		headless = false;
+	}
+
+	// Open the window at the size of the first recorded frame, so that
+	// playback doesn't start with a resize.
+	int windowWidth = 800;
+	int windowHeight = 600;
+	ReplayFrame firstFrame;
+	if (replayReader.isOpen() && replayReader.readFrame(firstFrame))
+	{
+		windowWidth = firstFrame.width;
+		windowHeight = firstFrame.height;
+		replayReader.rewind();
+	}
+
 	/* Request a double buffered window, with a sRGB color buffer, and a depth
-	 * buffer. Also, request the initial window size to be 800 x 600.
+	 * buffer. Also, request the initial window size to be 800 x 600 (or the
+	 * size of the replayed frames).
 	 *
 	 * Note: not all versions of GLUT define GLUT_SRGB; fall back to "normal"
 	 * RGB for those versions.
@@ -648,7 +844,7 @@ int main(int argc, char *argv[])
 	printf( "--\n" );
 	printf( "-- WARNING: your GLUT doesn't support sRGB / GLUT_SRGB\n" );
 #	endif // ~ GLUT_SRGB
-	glutInitWindowSize(800,600);
+	glutInitWindowSize(windowWidth, windowHeight);
 
 	/* Require at least OpenGL 3.0. Also request a Debug Context, which allows
 	 * us to use the Debug Message API for a somewhat more humane debugging
@@ -660,6 +856,10 @@ int main(int argc, char *argv[])
 	/* Request window
 	 */
 	glutCreateWindow("Project");
+	if (headless)
+	{
+		glutHideWindow();
+	}
 
 	/* Set callbacks that respond to various events. Most of these should be
 	 * rather self-explanatory (i.e., the MouseFunc is called in response to
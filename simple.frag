@@ -2,6 +2,9 @@
 // required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
 precision highp float;
 
+// Permutations, selected with #defines inserted by the shader manager:
+//   USE_REFLECTION - add reflections from the environment map
+
 // inputs from vertex shader.
 in vec4 color;
 in vec2 texCoord;
@@ -88,11 +91,16 @@ void main()
 	vec3 directionFromEye = normalize(viewSpacePosition);
 
 
+#ifdef USE_REFLECTION
 	vec3 reflectionVector = (inverseViewNormalMatrix *
 		vec4(reflect(directionFromEye, normal), 0.0)).xyz;
 	vec3 envMapSample = texture(environmentMap, reflectionVector).rgb;
 	vec3 fresnelSpecular = calculateFresnel(specular, normal,
 		directionFromEye);
+	vec3 reflection = envMapSample * fresnelSpecular * object_reflectiveness;
+#else
+	vec3 reflection = vec3(0.0);
+#endif
 
 	// if we have a texture we modulate all of the color properties
 	if (has_diffuse_texture == 1)
@@ -109,6 +117,6 @@ fragmentColor = vec4( calculateAmbient(scene_ambient_light, ambient) +
 		calculateSpecular(scene_light, specular, material_shininess, 
 		normal, directionToLight, directionFromEye) * visibility +
 		emissive +
-		envMapSample * fresnelSpecular * object_reflectiveness, object_alpha);
+		reflection, object_alpha);
 
 }